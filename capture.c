@@ -0,0 +1,446 @@
+#define _POSIX_C_SOURCE 199309L // clock_gettime
+#include "capture.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+    Container format (.c8v):
+        "C8V1", width (1 byte), height (1 byte)
+        per changed frame: frame number (4 bytes LE), payload length (2 bytes LE), payload
+    The payload is the XOR of the packed frame with the previous one, compressed with PackBits.
+*/
+static const char capture_magic[4] = { 'C', '8', 'V', '1' };
+
+/* ===== Encoding ===== */
+
+static void CAPTURE_Pack(const uint8_t *gfx, uint8_t *packed) {
+    memset(packed, 0, CAPTURE_FRAME_BYTES);
+    for (int i = 0; i < WIDTH * HEIGHT; i++) {
+        if (gfx[i]) packed[i >> 3] |= 0x80 >> (i & 7);
+    }
+}
+
+/*
+    PackBits: a control byte n < 128 is followed by n + 1 literal bytes,
+    n > 128 by a single byte that is repeated 257 - n times.
+    Returns the number of bytes written to out (at most length + length / 128 + 1).
+*/
+static int CAPTURE_PackBits(const uint8_t *in, int length, uint8_t *out) {
+    int o = 0;
+    int i = 0;
+    while (i < length) {
+        int run = 1;
+        while (i + run < length && run < 128 && in[i + run] == in[i]) run++;
+        if (run >= 3) {
+            out[o++] = (uint8_t) (257 - run);
+            out[o++] = in[i];
+            i += run;
+            continue;
+        }
+
+        // literals, up to the next run of at least 3 equal bytes
+        int start = i;
+        while (i < length && i - start < 128) {
+            if (i + 2 < length && in[i] == in[i + 1] && in[i] == in[i + 2]) break;
+            i++;
+        }
+        out[o++] = (uint8_t) (i - start - 1);
+        memcpy(out + o, in + start, i - start);
+        o += i - start;
+    }
+    return o;
+}
+
+static void CAPTURE_Encode(Capture *capture, const CaptureFrame *frame) {
+    uint8_t delta[CAPTURE_FRAME_BYTES];
+    uint8_t payload[CAPTURE_FRAME_BYTES + CAPTURE_FRAME_BYTES / 128 + 1];
+    for (int i = 0; i < CAPTURE_FRAME_BYTES; i++) delta[i] = frame->pixels[i] ^ capture->previous[i];
+    memcpy(capture->previous, frame->pixels, CAPTURE_FRAME_BYTES);
+
+    int length = CAPTURE_PackBits(delta, CAPTURE_FRAME_BYTES, payload);
+    uint8_t header[6] = {
+        frame->number & 0xFF, (frame->number >> 8) & 0xFF, (frame->number >> 16) & 0xFF, frame->number >> 24,
+        length & 0xFF, length >> 8
+    };
+    fwrite(header, 1, sizeof(header), capture->out);
+    fwrite(payload, 1, length, capture->out);
+}
+
+/*
+    Drains the queue into the container file until the capture is stopped.
+*/
+static void *CAPTURE_Worker(void *arg) {
+    Capture *capture = (Capture*) arg;
+    for (;;) {
+        uint32_t tail = capture->tail;
+        if (tail == __atomic_load_n(&capture->head, __ATOMIC_ACQUIRE)) {
+            if (!__atomic_load_n(&capture->running, __ATOMIC_ACQUIRE)) break;
+            // a signal can be missed if the producer's trylock fails, so don't wait for longer than 5 ms
+            struct timespec deadline;
+            clock_gettime(CLOCK_REALTIME, &deadline);
+            deadline.tv_nsec += 5000000;
+            if (deadline.tv_nsec >= 1000000000) {
+                deadline.tv_sec++;
+                deadline.tv_nsec -= 1000000000;
+            }
+            pthread_mutex_lock(&capture->lock);
+            if (tail == __atomic_load_n(&capture->head, __ATOMIC_ACQUIRE)) {
+                pthread_cond_timedwait(&capture->wake, &capture->lock, &deadline);
+            }
+            pthread_mutex_unlock(&capture->lock);
+            continue;
+        }
+        CAPTURE_Encode(capture, &capture->queue[tail % CAPTURE_QUEUE_SIZE]);
+        __atomic_store_n(&capture->tail, tail + 1, __ATOMIC_RELEASE);
+    }
+    return NULL;
+}
+
+/*
+    Opens the container file and starts the worker thread.
+    Returns 1 if successfull, 0 if not.
+*/
+int CAPTURE_Start(Capture *capture, const char *path) {
+    memset(capture, 0, sizeof(Capture));
+    capture->out = fopen(path, "wb");
+    if (capture->out == NULL) {
+        fprintf(stderr, "Could not open %s for writing.\n", path);
+        return 0;
+    }
+    fwrite(capture_magic, 1, sizeof(capture_magic), capture->out);
+    fputc(WIDTH, capture->out);
+    fputc(HEIGHT, capture->out);
+
+    // make sure the first frame is recorded, even if it is blank
+    memset(capture->last, 0xFF, CAPTURE_FRAME_BYTES);
+    capture->running = 1;
+    pthread_mutex_init(&capture->lock, NULL);
+    pthread_cond_init(&capture->wake, NULL);
+    if (pthread_create(&capture->worker, NULL, CAPTURE_Worker, capture) != 0) {
+        fprintf(stderr, "Could not start the capture thread.\n");
+        fclose(capture->out);
+        return 0;
+    }
+    return 1;
+}
+
+/*
+    Called by the emulation thread once per frame. If the image did not change it is skipped.
+    If the queue is full the frame is dropped and counted, so this never blocks,
+    unless the capture is lossless.
+*/
+void CAPTURE_Frame(Capture *capture, const uint8_t *gfx) {
+    uint8_t packed[CAPTURE_FRAME_BYTES];
+    uint32_t number = capture->frame++;
+
+    CAPTURE_Pack(gfx, packed);
+    if (memcmp(packed, capture->last, CAPTURE_FRAME_BYTES) == 0) return;
+
+    uint32_t head = capture->head;
+    while (head - __atomic_load_n(&capture->tail, __ATOMIC_ACQUIRE) == CAPTURE_QUEUE_SIZE) {
+        if (!capture->lossless) {
+            capture->dropped++;
+            return;
+        }
+        struct timespec pause = { 0, 100000 };
+        nanosleep(&pause, NULL);
+    }
+    CaptureFrame *slot = &capture->queue[head % CAPTURE_QUEUE_SIZE];
+    slot->number = number;
+    memcpy(slot->pixels, packed, CAPTURE_FRAME_BYTES);
+    memcpy(capture->last, packed, CAPTURE_FRAME_BYTES);
+    capture->captured++;
+    __atomic_store_n(&capture->head, head + 1, __ATOMIC_RELEASE);
+
+    if (pthread_mutex_trylock(&capture->lock) == 0) {
+        pthread_cond_signal(&capture->wake);
+        pthread_mutex_unlock(&capture->lock);
+    }
+}
+
+/*
+    Lets the worker drain the queue, then closes the container file.
+*/
+void CAPTURE_Stop(Capture *capture) {
+    __atomic_store_n(&capture->running, 0, __ATOMIC_RELEASE);
+    pthread_join(capture->worker, NULL);
+    pthread_mutex_destroy(&capture->lock);
+    pthread_cond_destroy(&capture->wake);
+    fclose(capture->out);
+}
+
+/* ===== Decoding and export ===== */
+
+/*
+    Reads the next record of a container and applies it to `frame`.
+    Returns 1 if a frame was read, 0 at the end of the file (or if it is corrupt).
+*/
+static int CAPTURE_ReadFrame(FILE *f, uint8_t *frame, uint32_t *number) {
+    uint8_t header[6];
+    uint8_t payload[CAPTURE_FRAME_BYTES + CAPTURE_FRAME_BYTES / 128 + 1];
+    if (fread(header, 1, sizeof(header), f) != sizeof(header)) return 0;
+    *number = header[0] | header[1] << 8 | header[2] << 16 | (uint32_t) header[3] << 24;
+    int length = header[4] | header[5] << 8;
+    if (length > (int) sizeof(payload) || fread(payload, 1, length, f) != (size_t) length) return 0;
+
+    int o = 0;
+    for (int i = 0; i < length; ) {
+        int n = payload[i++];
+        if (n < 128) {
+            if (o + n + 1 > CAPTURE_FRAME_BYTES || i + n + 1 > length) return 0;
+            for (int j = 0; j <= n; j++) frame[o++] ^= payload[i++];
+        } else if (n > 128) {
+            if (o + 257 - n > CAPTURE_FRAME_BYTES || i >= length) return 0;
+            for (int j = 0; j < 257 - n; j++) frame[o++] ^= payload[i];
+            i++;
+        }
+    }
+    return o == CAPTURE_FRAME_BYTES;
+}
+
+static int CAPTURE_Pixel(const uint8_t *frame, int x, int y) {
+    int i = y * WIDTH + x;
+    return (frame[i >> 3] >> (7 - (i & 7))) & 1;
+}
+
+static void CAPTURE_Put32(FILE *f, uint32_t value) {
+    fputc(value >> 24, f);
+    fputc((value >> 16) & 0xFF, f);
+    fputc((value >> 8) & 0xFF, f);
+    fputc(value & 0xFF, f);
+}
+
+static uint32_t CAPTURE_Crc32(uint32_t crc, const uint8_t *data, size_t length) {
+    crc = ~crc;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1));
+    }
+    return ~crc;
+}
+
+static void CAPTURE_PngChunk(FILE *f, const char *type, const uint8_t *data, uint32_t length) {
+    CAPTURE_Put32(f, length);
+    fwrite(type, 1, 4, f);
+    fwrite(data, 1, length, f);
+    uint32_t crc = CAPTURE_Crc32(0, (const uint8_t*) type, 4);
+    CAPTURE_Put32(f, CAPTURE_Crc32(crc, data, length));
+}
+
+/*
+    Writes a 1-bit grayscale PNG. The image data is stored in uncompressed deflate blocks,
+    which keeps this free of zlib and is small enough at one bit per pixel.
+*/
+static int CAPTURE_WritePng(FILE *f, const uint8_t *frame, int scale) {
+    static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+    uint32_t w = WIDTH * scale, h = HEIGHT * scale;
+    uint32_t stride = (w + 7) / 8 + 1; // +1 for the filter byte
+    uint32_t raw_size = stride * h;
+    uint32_t blocks = (raw_size + 65534) / 65535;
+    uint8_t *raw = (uint8_t*) calloc(raw_size, 1);
+    uint8_t *z = (uint8_t*) malloc(2 + raw_size + blocks * 5 + 4);
+    if (raw == NULL || z == NULL) {
+        free(raw);
+        free(z);
+        return 0;
+    }
+
+    for (uint32_t y = 0; y < h; y++) {
+        for (uint32_t x = 0; x < w; x++) {
+            if (CAPTURE_Pixel(frame, x / scale, y / scale)) raw[y * stride + 1 + (x >> 3)] |= 0x80 >> (x & 7);
+        }
+    }
+
+    // zlib stream with stored blocks
+    uint32_t zl = 0, a = 1, b = 0;
+    z[zl++] = 0x78;
+    z[zl++] = 0x01;
+    for (uint32_t pos = 0; pos < raw_size; pos += 65535) {
+        uint32_t n = raw_size - pos < 65535 ? raw_size - pos : 65535;
+        z[zl++] = pos + n == raw_size; // BFINAL, BTYPE = 00
+        z[zl++] = n & 0xFF;
+        z[zl++] = n >> 8;
+        z[zl++] = ~n & 0xFF;
+        z[zl++] = (~n >> 8) & 0xFF;
+        memcpy(z + zl, raw + pos, n);
+        zl += n;
+    }
+    for (uint32_t i = 0; i < raw_size; i++) {
+        a = (a + raw[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+    z[zl++] = b >> 8;
+    z[zl++] = b & 0xFF;
+    z[zl++] = a >> 8;
+    z[zl++] = a & 0xFF;
+
+    uint8_t ihdr[13] = {
+        w >> 24, (w >> 16) & 0xFF, (w >> 8) & 0xFF, w & 0xFF,
+        h >> 24, (h >> 16) & 0xFF, (h >> 8) & 0xFF, h & 0xFF,
+        1, 0, 0, 0, 0 // bit depth 1, grayscale, no interlacing
+    };
+    fwrite(signature, 1, sizeof(signature), f);
+    CAPTURE_PngChunk(f, "IHDR", ihdr, sizeof(ihdr));
+    CAPTURE_PngChunk(f, "IDAT", z, zl);
+    CAPTURE_PngChunk(f, "IEND", NULL, 0);
+
+    free(raw);
+    free(z);
+    return 1;
+}
+
+typedef struct GifBits {
+    FILE *f;
+    uint8_t block[255];
+    int length;
+    uint32_t bits;
+    int count;
+} GifBits;
+
+static void CAPTURE_GifPut(GifBits *out, int code, int size) {
+    out->bits |= (uint32_t) code << out->count;
+    out->count += size;
+    while (out->count >= 8) {
+        out->block[out->length++] = out->bits & 0xFF;
+        out->bits >>= 8;
+        out->count -= 8;
+        if (out->length == 255) {
+            fputc(255, out->f);
+            fwrite(out->block, 1, 255, out->f);
+            out->length = 0;
+        }
+    }
+}
+
+/*
+    Writes one full-size GIF image, LZW compressed with a two color palette.
+*/
+static int CAPTURE_WriteGifImage(FILE *f, const uint8_t *frame, int scale, int delay) {
+    uint16_t w = WIDTH * scale, h = HEIGHT * scale;
+    // children of each code for the pixel values 0-3 (the minimum code size is 2)
+    uint16_t (*dict)[4] = calloc(4096, sizeof(*dict));
+    if (dict == NULL) return 0;
+
+    uint8_t gce[8] = { 0x21, 0xF9, 4, 0, delay & 0xFF, delay >> 8, 0, 0 };
+    uint8_t descriptor[10] = { 0x2C, 0, 0, 0, 0, w & 0xFF, w >> 8, h & 0xFF, h >> 8, 0 };
+    fwrite(gce, 1, sizeof(gce), f);
+    fwrite(descriptor, 1, sizeof(descriptor), f);
+    fputc(2, f);
+
+    GifBits out = { f, { 0 }, 0, 0, 0 };
+    int size = 3, next = 6;
+    int prefix = -1;
+    CAPTURE_GifPut(&out, 4, size); // clear
+    for (uint32_t i = 0; i < (uint32_t) w * h; i++) {
+        int pixel = CAPTURE_Pixel(frame, (i % w) / scale, (i / w) / scale);
+        if (prefix < 0) {
+            prefix = pixel;
+        } else if (dict[prefix][pixel]) {
+            prefix = dict[prefix][pixel];
+        } else {
+            CAPTURE_GifPut(&out, prefix, size);
+            if (next < 4096) {
+                if (next == (1 << size)) size++;
+                dict[prefix][pixel] = next++;
+            } else {
+                CAPTURE_GifPut(&out, 4, size);
+                memset(dict, 0, 4096 * sizeof(*dict));
+                size = 3;
+                next = 6;
+            }
+            prefix = pixel;
+        }
+    }
+    CAPTURE_GifPut(&out, prefix, size);
+    CAPTURE_GifPut(&out, 5, size); // end of information
+    CAPTURE_GifPut(&out, 0, 7); // flush the last byte
+    if (out.length > 0) {
+        fputc(out.length, f);
+        fwrite(out.block, 1, out.length, f);
+    }
+    fputc(0, f);
+
+    free(dict);
+    return 1;
+}
+
+static void CAPTURE_WriteY4mFrame(FILE *f, const uint8_t *frame, int scale) {
+    int w = WIDTH * scale, h = HEIGHT * scale;
+    fputs("FRAME\n", f);
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) fputc(CAPTURE_Pixel(frame, x / scale, y / scale) ? 235 : 16, f);
+    }
+    // neutral chroma planes
+    for (int i = 0; i < w * h / 2; i++) fputc(128, f);
+}
+
+/*
+    Converts a capture container into a PNG (last frame), an animated GIF or a y4m video.
+    Frames keep their original timing at 60 frames per second. Pixels are scaled by `scale`.
+    Returns 1 if successfull, 0 if not.
+*/
+int CAPTURE_Export(const char *path, const char *out_path, CaptureFormat format, int scale) {
+    char magic[4];
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "Could not open %s.\n", path);
+        return 0;
+    }
+    if (fread(magic, 1, 4, f) != 4 || memcmp(magic, capture_magic, 4) != 0
+            || fgetc(f) != WIDTH || fgetc(f) != HEIGHT) {
+        fprintf(stderr, "%s is not a capture file.\n", path);
+        fclose(f);
+        return 0;
+    }
+    FILE *out = fopen(out_path, "wb");
+    if (out == NULL) {
+        fprintf(stderr, "Could not open %s for writing.\n", out_path);
+        fclose(f);
+        return 0;
+    }
+    if (scale < 1) scale = 1;
+    if (format == CAPTURE_GIF && scale > CAPTURE_MAX_SCALE) scale = CAPTURE_MAX_SCALE;
+
+    uint8_t frame[CAPTURE_FRAME_BYTES] = { 0 };
+    uint8_t shown[CAPTURE_FRAME_BYTES] = { 0 };
+    uint32_t number = 0, shown_number = 0;
+    int have_frame = 0, ok = 1;
+
+    if (format == CAPTURE_GIF) {
+        uint16_t w = WIDTH * scale, h = HEIGHT * scale;
+        uint8_t screen[13] = { 'G', 'I', 'F', '8', '9', 'a', w & 0xFF, w >> 8, h & 0xFF, h >> 8, 0x80, 0, 0 };
+        uint8_t palette[6] = { 0, 0, 0, 255, 255, 255 };
+        uint8_t loop[19] = { 0x21, 0xFF, 11, 'N', 'E', 'T', 'S', 'C', 'A', 'P', 'E', '2', '.', '0', 3, 1, 0, 0, 0 };
+        fwrite(screen, 1, sizeof(screen), out);
+        fwrite(palette, 1, sizeof(palette), out);
+        fwrite(loop, 1, sizeof(loop), out);
+    } else if (format == CAPTURE_Y4M) {
+        fprintf(out, "YUV4MPEG2 W%d H%d F60:1 Ip A1:1 C420jpeg\n", WIDTH * scale, HEIGHT * scale);
+    }
+
+    while (CAPTURE_ReadFrame(f, frame, &number)) {
+        // a frame is written once the next one is known, as that determines how long it is shown
+        if (have_frame) {
+            uint32_t frames = number - shown_number;
+            // GIF delays are in 1/100 s and 16 bits wide, i.e. at most about 655 s
+            uint32_t delay = frames > (65535u * 60 - 30) / 100 ? 65535 : (frames * 100 + 30) / 60;
+            if (format == CAPTURE_GIF) ok &= CAPTURE_WriteGifImage(out, shown, scale, delay);
+            else if (format == CAPTURE_Y4M) while (frames--) CAPTURE_WriteY4mFrame(out, shown, scale);
+        }
+        memcpy(shown, frame, CAPTURE_FRAME_BYTES);
+        shown_number = number;
+        have_frame = 1;
+    }
+
+    if (have_frame) {
+        if (format == CAPTURE_PNG) ok &= CAPTURE_WritePng(out, shown, scale);
+        else if (format == CAPTURE_GIF) ok &= CAPTURE_WriteGifImage(out, shown, scale, 100);
+        else CAPTURE_WriteY4mFrame(out, shown, scale);
+    }
+    if (format == CAPTURE_GIF) fputc(0x3B, out);
+
+    fclose(out);
+    fclose(f);
+    return ok && have_frame;
+}
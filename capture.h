@@ -0,0 +1,58 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include "chip8.h"
+#include <stdio.h>
+#include <pthread.h>
+
+// A frame packed to one bit per pixel, MSB first
+#define CAPTURE_FRAME_BYTES (WIDTH * HEIGHT / 8)
+// Largest export scale, GIF stores the image size in 16 bits (64 * 1023 < 65536)
+#define CAPTURE_MAX_SCALE   1023
+// Frames that can be queued for the worker, must be a power of two
+#define CAPTURE_QUEUE_SIZE  64
+
+typedef struct CaptureFrame {
+    uint32_t number; // emulation frame the image belongs to
+    uint8_t pixels[CAPTURE_FRAME_BYTES];
+} CaptureFrame;
+
+/*
+    Single producer (emulation thread), single consumer (worker) ring buffer.
+    head is only written by the producer and tail only by the consumer.
+*/
+typedef struct Capture {
+    CaptureFrame queue[CAPTURE_QUEUE_SIZE];
+    uint32_t head;
+    uint32_t tail;
+
+    // last frame handed to the queue, unchanged frames are skipped
+    uint8_t last[CAPTURE_FRAME_BYTES];
+    uint32_t frame;
+    uint32_t captured;
+    uint32_t dropped;
+    // set after CAPTURE_Start to wait for the worker instead of dropping frames, for headless runs
+    int lossless;
+
+    // worker only
+    FILE *out;
+    uint8_t previous[CAPTURE_FRAME_BYTES];
+    int running;
+    pthread_t worker;
+    // wakes the worker up, the producer only ever signals it with a trylock
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+} Capture;
+
+typedef enum CaptureFormat {
+    CAPTURE_PNG,    // last frame as a single image
+    CAPTURE_GIF,    // animation
+    CAPTURE_Y4M     // raw video
+} CaptureFormat;
+
+int CAPTURE_Start(Capture *capture, const char *path);
+void CAPTURE_Frame(Capture *capture, const uint8_t *gfx);
+void CAPTURE_Stop(Capture *capture);
+int CAPTURE_Export(const char *path, const char *out_path, CaptureFormat format, int scale);
+
+#endif
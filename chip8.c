@@ -39,35 +39,120 @@ void CHIP8_Initialize(Chip8 *chip8) {
     chip8->I = 0;
     chip8->sp = 0;
 
+    chip8->cycles_per_frame = CYCLES_PER_FRAME;
     chip8->delay_timer = 0;
     chip8->sound_timer = 0;
 
+    CHIP8_Seed(chip8, 1);
+    memset(chip8->fusion, FUSE_NONE, sizeof(chip8->fusion));
+    chip8->dispatches = 0;
+
     // Load fontset
     memcpy(chip8->memory + MEM_FONT_SET, chip8_fontset, 80);
 }
 
+/*
+    Seeds the random number generator used by the RND instruction.
+*/
+void CHIP8_Seed(Chip8 *chip8, uint32_t seed) {
+    chip8->rng = seed != 0 ? seed : 1; // xorshift gets stuck at 0
+}
+
+/*
+    Snapshots the complete machine state into `state`.
+    The Chip8 struct holds no pointers, so a plain copy is all it takes (about 10 KB,
+    4 KB of which are the fusion table; copying it is cheaper than running CHIP8_Fuse again).
+*/
+void CHIP8_SaveState(const Chip8 *chip8, Chip8 *state) {
+    *state = *chip8;
+}
+
+/*
+    Restores a snapshot taken with CHIP8_SaveState.
+*/
+void CHIP8_LoadState(Chip8 *chip8, const Chip8 *state) {
+    *chip8 = *state;
+}
+
 /*
     Loads a program into memory at address 0x200.
     program_size expects the size to be given in bytes (i.e. the length of the program array)
+    Returns 1 if successfull, 0 if the program does not fit into memory.
 */
-void CHIP8_LoadProgram(Chip8 *chip8, uint8_t *program, size_t program_size) {
+int CHIP8_LoadProgram(Chip8 *chip8, const uint8_t *program, size_t program_size) {
+    if (program_size > MAX_PROGRAM_SIZE) return 0;
     memcpy(chip8->memory + MEM_ROM_RAM, program, program_size);
+    CHIP8_Fuse(chip8, 0, 4096);
+    return 1;
+}
+
+/*
+    Returns the superinstruction that starts at the given address (FUSE_NONE if there is none).
+    The operands are read from memory again when it is executed,
+    so this only depends on the instructions' types and registers.
+*/
+static uint8_t CHIP8_DetectFusion(const uint8_t *memory, int addr) {
+    if (addr + 4 > 4096) return FUSE_NONE;
+    uint16_t a = memory[addr] << 8 | memory[addr + 1];
+    uint16_t b = memory[addr + 2] << 8 | memory[addr + 3];
+    // b is SE/SNE on the same register a works on
+    int skips_x = ((b & 0xF000) == 0x3000 || (b & 0xF000) == 0x4000) && (b & 0x0F00) == (a & 0x0F00);
+
+    if ((a & 0xF0FF) == 0xF007 && skips_x && addr + 6 <= 4096 && (memory[addr + 4] & 0xF0) == 0x10) return FUSE_WAIT_DT;
+    if ((a & 0xF000) == 0xA000 && (b & 0xF000) == 0xD000) return FUSE_DRAW;
+    if ((a & 0xF000) == 0x7000 && skips_x) return FUSE_COUNT_SKIP;
+    if (((a & 0xF0FF) == 0xF055 || (a & 0xF0FF) == 0xF065) && (b & 0xF000) == 0x2000) return FUSE_REGS_CALL;
+    return FUSE_NONE;
+}
+
+/*
+    Updates the superinstructions after memory[start] to memory[start + length - 1] changed.
+    A fused sequence is at most 6 bytes long, so the ones starting up to 5 bytes earlier are affected as well.
+    Jumps into the middle of a sequence need no special care, as sequences are looked up by their first address.
+*/
+void CHIP8_Fuse(Chip8 *chip8, int start, int length) {
+    if (start >= 4096) return;
+    int end = start + length > 4096 ? 4096 : start + length;
+    for (int addr = start > 5 ? start - 5 : 0; addr < end; addr++) {
+        chip8->fusion[addr] = CHIP8_DetectFusion(chip8->memory, addr);
+    }
 }
 
 /*
     One emulation cycle.
-    Executed the current instruction and updates the timers.
+    Executes cycles_per_frame instructions and updates the timers.
+    Fused sequences are dispatched at once, unless they would cross the end of the frame.
     Should be called 60 times per second for proper emulation.
 */
 void CHIP8_EmulateCycle(Chip8 *chip8) {
-    for (int i = 0; i < 15; i++) {
-        // Fetch Opcode
-        chip8->opcode = chip8->memory[chip8->pc] << 8 | chip8->memory[chip8->pc + 1];
-        // Ececute Opcode
-        call_instruction[(chip8->opcode & 0xF000) >> 12](chip8);
+    int i = 0;
+    while (i < chip8->cycles_per_frame) {
+        uint8_t fused = chip8->pc < 4096 ? chip8->fusion[chip8->pc] : FUSE_NONE;
+        if (fused != FUSE_NONE && i + fused_length[fused] <= chip8->cycles_per_frame) {
+            i += call_fused[fused](chip8);
+        } else {
+            CHIP8_Step(chip8);
+            i++;
+        }
+        chip8->dispatches++;
     }
+    CHIP8_UpdateTimers(chip8);
+}
 
-    // Update timers
+/*
+    Fetches and executes the instruction at the program counter.
+*/
+void CHIP8_Step(Chip8 *chip8) {
+    // Fetch Opcode
+    chip8->opcode = chip8->memory[chip8->pc] << 8 | chip8->memory[chip8->pc + 1];
+    // Ececute Opcode
+    call_instruction[(chip8->opcode & 0xF000) >> 12](chip8);
+}
+
+/*
+    Decrements the delay and sound timers. Called once per emulation cycle.
+*/
+void CHIP8_UpdateTimers(Chip8 *chip8) {
     if (chip8->delay_timer > 0) chip8->delay_timer--;
     if (chip8->sound_timer > 0) {
         chip8->sound_timer--;
@@ -172,7 +257,11 @@ void jump_offset(Chip8 *chip8) {
 }
 
 void random_and(Chip8 *chip8) {
-    chip8->V[(chip8->opcode & 0x0F00) >> 8] = (rand() % 256) & (chip8->opcode & 0x00FF);
+    // xorshift32, the state lives in the Chip8 struct (see CHIP8_Seed)
+    chip8->rng ^= chip8->rng << 13;
+    chip8->rng ^= chip8->rng >> 17;
+    chip8->rng ^= chip8->rng << 5;
+    chip8->V[(chip8->opcode & 0x0F00) >> 8] = (chip8->rng >> 24) & (chip8->opcode & 0x00FF);
     chip8->pc += 2;
 }
 
@@ -252,10 +341,12 @@ void SUB_load_add(Chip8 *chip8) {
             chip8->memory[chip8->I] = chip8->V[x] / 100; // hundreds digit
             chip8->memory[chip8->I + 1] = (chip8->V[x] % 100) / 10; // tens digit
             chip8->memory[chip8->I + 2] = ((chip8->V[x] % 100) % 10); // ones digit
+            CHIP8_Fuse(chip8, chip8->I, 3); // the program may modify its own code
             break;
         case 0x55:
             // Make sure we don't copy more than we have (registers)
             memcpy(chip8->memory + chip8->I, chip8->V, bytes);
+            CHIP8_Fuse(chip8, chip8->I, bytes);
             break;
         case 0x65:
             // Make sure we don't read more than have (registers)
@@ -322,3 +413,70 @@ void shift_left(Chip8 *chip8) {
     chip8->V[15] = (chip8->V[(chip8->opcode & 0x0F00) >> 8] & 0x80) >> 7; // set the flag if MSB of x is 1
     chip8->V[(chip8->opcode & 0x0F00) >> 8] <<= 1;
 }
+
+/* ===== Superinstructions ===== */
+/* Each one behaves exactly like its instructions executed one by one, with chip8->pc pointing to the first one */
+
+/*
+    LD Vx, DT; SE/SNE Vx, kk; JP nnn
+    Waiting for the delay timer to expire.
+*/
+int fused_wait_dt(Chip8 *chip8) {
+    uint16_t pc = chip8->pc;
+    uint8_t x = chip8->memory[pc] & 0x0F;
+    uint16_t skip = chip8->memory[pc + 2] << 8 | chip8->memory[pc + 3];
+
+    chip8->V[x] = chip8->delay_timer;
+    // SE (3xkk) skips the jump if equal, SNE (4xkk) if not
+    if ((chip8->V[x] == (skip & 0x00FF)) == ((skip & 0xF000) == 0x3000)) {
+        chip8->opcode = skip;
+        chip8->pc = pc + 6;
+        return 2;
+    }
+    chip8->opcode = chip8->memory[pc + 4] << 8 | chip8->memory[pc + 5];
+    chip8->pc = chip8->opcode & 0x0FFF;
+    return 3;
+}
+
+/*
+    LD I, nnn; DRW Vx, Vy, n
+*/
+int fused_draw(Chip8 *chip8) {
+    uint16_t pc = chip8->pc;
+    chip8->I = (chip8->memory[pc] << 8 | chip8->memory[pc + 1]) & 0x0FFF;
+    chip8->opcode = chip8->memory[pc + 2] << 8 | chip8->memory[pc + 3];
+    chip8->pc = pc + 2;
+    draw(chip8);
+    return 2;
+}
+
+/*
+    ADD Vx, kk; SE/SNE Vx, jj
+    Loop counters.
+*/
+int fused_count_skip(Chip8 *chip8) {
+    uint16_t pc = chip8->pc;
+    uint8_t x = chip8->memory[pc] & 0x0F;
+    chip8->V[x] += chip8->memory[pc + 1];
+    chip8->opcode = chip8->memory[pc + 2] << 8 | chip8->memory[pc + 3];
+    if ((chip8->V[x] == (chip8->opcode & 0x00FF)) == ((chip8->opcode & 0xF000) == 0x3000)) chip8->pc = pc + 6;
+    else chip8->pc = pc + 4;
+    return 2;
+}
+
+/*
+    LD [I], Vx / LD Vx, [I]; CALL nnn
+    Saving or restoring registers around a subroutine call.
+*/
+int fused_regs_call(Chip8 *chip8) {
+    uint16_t pc = chip8->pc;
+    chip8->opcode = chip8->memory[pc] << 8 | chip8->memory[pc + 1];
+    SUB_load_add(chip8);
+
+    // LD [I], Vx may have overwritten the CALL
+    uint16_t next = chip8->memory[pc + 2] << 8 | chip8->memory[pc + 3];
+    if ((next & 0xF000) != 0x2000) return 1;
+    chip8->opcode = next;
+    call(chip8);
+    return 2;
+}
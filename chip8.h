@@ -1,8 +1,17 @@
+#ifndef CHIP8_H
+#define CHIP8_H
+
+#include <stddef.h>
 #include <stdint.h>
 
 #define WIDTH   64
 #define HEIGHT  32
 
+// Default number of instructions executed per call to CHIP8_EmulateCycle (i.e. per 1/60 s)
+#define CYCLES_PER_FRAME    15
+// Largest program that fits into memory
+#define MAX_PROGRAM_SIZE    (4096 - MEM_ROM_RAM)
+
 #define MEM_FONT_SET    0x050
 #define MEM_ROM_RAM     0x200
 
@@ -25,16 +34,37 @@ typedef struct Chip8 {
     // Screen pixels
     uint8_t gfx[64 * 32];
 
+    // Clock: instructions per frame
+    uint16_t cycles_per_frame;
+
     // Timers
     uint8_t delay_timer;
     uint8_t sound_timer;
 
     // Keyboard
     uint8_t key[16];
+
+    // State of the random number generator, part of the machine state so that
+    // snapshots (and runs with a fixed seed) are reproducible
+    uint32_t rng;
+
+    // Superinstructions: for every address, the fused sequence of instructions that
+    // starts there (0 if none). Kept up to date when the program writes to memory.
+    uint8_t fusion[4096];
+    // number of handlers dispatched by CHIP8_EmulateCycle, fused sequences count once
+    uint32_t dispatches;
 } Chip8;
 
 void CHIP8_Initialize(Chip8 *chip8);
-void CHIP8_LoadProgram(Chip8 *chip8, uint8_t *program, size_t program_size);
+void CHIP8_Seed(Chip8 *chip8, uint32_t seed);
+void CHIP8_SaveState(const Chip8 *chip8, Chip8 *state);
+void CHIP8_LoadState(Chip8 *chip8, const Chip8 *state);
+int CHIP8_LoadProgram(Chip8 *chip8, const uint8_t *program, size_t program_size);
+void CHIP8_Fuse(Chip8 *chip8, int start, int length);
 void CHIP8_EmulateCycle(Chip8 *chip8);
+void CHIP8_Step(Chip8 *chip8);
+void CHIP8_UpdateTimers(Chip8 *chip8);
 void CHIP8_RegisterDump(Chip8 *chip8);
 void CHIP8_MemoryDump(Chip8 *chip8, uint16_t start, uint16_t length);
+
+#endif
@@ -0,0 +1,257 @@
+#include "debugger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define BIT_GET(bits, i)    ((bits)[(i) >> 3] & (1 << ((i) & 7)))
+#define BIT_FLIP(bits, i)   ((bits)[(i) >> 3] ^= (1 << ((i) & 7)))
+
+/*
+    Clears all breakpoints and watchpoints. The debugger starts out running.
+*/
+void DEBUGGER_Initialize(Debugger *debugger) {
+    memset(debugger->breakpoints, 0, sizeof(debugger->breakpoints));
+    memset(debugger->watch_memory, 0, sizeof(debugger->watch_memory));
+    debugger->watch_registers = 0;
+    debugger->armed = 0;
+    debugger->stopped = 0;
+    debugger->skip_break = 0;
+    debugger->cycle = 0;
+    debugger->steps = 0;
+    debugger->profiler = NULL;
+    debugger->has_command = 0;
+}
+
+/*
+    Reads commands from stdin. Blocks on its own thread only, each line is handed
+    over to the main thread which picks it up in DEBUGGER_PollConsole.
+*/
+static void *DEBUGGER_ConsoleThread(void *arg) {
+    Debugger *debugger = (Debugger*) arg;
+    char line[sizeof(debugger->command)];
+    while (fgets(line, sizeof(line), stdin) != NULL) {
+        pthread_mutex_lock(&debugger->lock);
+        while (debugger->has_command) pthread_cond_wait(&debugger->consumed, &debugger->lock);
+        strcpy(debugger->command, line);
+        debugger->has_command = 1;
+        pthread_mutex_unlock(&debugger->lock);
+    }
+    return NULL;
+}
+
+/*
+    Starts the console thread.
+    Returns 1 if successfull, 0 if not.
+*/
+int DEBUGGER_StartConsole(Debugger *debugger) {
+    pthread_mutex_init(&debugger->lock, NULL);
+    pthread_cond_init(&debugger->consumed, NULL);
+    if (pthread_create(&debugger->console, NULL, DEBUGGER_ConsoleThread, debugger) != 0) {
+        fprintf(stderr, "Could not start the debugger console.\n");
+        return 0;
+    }
+    pthread_detach(debugger->console);
+    return 1;
+}
+
+/*
+    Executes a pending console command, if there is one. Never blocks.
+*/
+void DEBUGGER_PollConsole(Debugger *debugger, Chip8 *chip8) {
+    char line[sizeof(debugger->command)];
+    if (pthread_mutex_trylock(&debugger->lock) != 0) return;
+    if (!debugger->has_command) {
+        pthread_mutex_unlock(&debugger->lock);
+        return;
+    }
+    strcpy(line, debugger->command);
+    debugger->has_command = 0;
+    pthread_cond_signal(&debugger->consumed);
+    pthread_mutex_unlock(&debugger->lock);
+
+    DEBUGGER_Command(debugger, chip8, line);
+}
+
+static void DEBUGGER_Stop(Debugger *debugger, Chip8 *chip8, const char *reason) {
+    debugger->stopped = 1;
+    printf("%s, stopped at 0x%03X (%04X)\n", reason, chip8->pc,
+        chip8->memory[chip8->pc] << 8 | chip8->memory[chip8->pc + 1]);
+}
+
+static void DEBUGGER_List(Debugger *debugger) {
+    printf("===== Breakpoints and Watchpoints =====\n");
+    for (int i = 0; i < 4096; i++) {
+        if (BIT_GET(debugger->breakpoints, i)) printf("\tbreak 0x%03X\n", i);
+        if (BIT_GET(debugger->watch_memory, i)) printf("\twatch mem[%x]\n", i);
+    }
+    for (int i = 0; i < 16; i++) {
+        if (debugger->watch_registers & (1u << i)) printf("\twatch V[%x]\n", i);
+    }
+    if (debugger->watch_registers & DEBUGGER_WATCH_I) printf("\twatch I\n");
+    printf("===== End of List =====\n");
+}
+
+/*
+    Executes a single debugger command:
+        r               register dump
+        m <addr> <len>  memory dump
+        b <addr>        toggle breakpoint
+        w <addr>        toggle memory watchpoint
+        wv <x>          toggle watchpoint on Vx
+        wi              toggle watchpoint on I
+        l               list breakpoints and watchpoints
+        s [n]           step n instructions (default 1), a frame's worth per DEBUGGER_ContinueSteps
+        c               continue
+*/
+void DEBUGGER_Command(Debugger *debugger, Chip8 *chip8, const char *line) {
+    char cmd[8] = "";
+    unsigned long a = 0, b = 0;
+    char *end, *b_end;
+    if (sscanf(line, "%7s", cmd) != 1) return;
+    const char *args = strstr(line, cmd) + strlen(cmd);
+
+    a = strtoul(args, &end, 0);
+    int has_a = end != args;
+    b = strtoul(end, &b_end, 0);
+    int has_b = b_end != end;
+
+    if (strcmp(cmd, "r") == 0) {
+        CHIP8_RegisterDump(chip8);
+    } else if (strcmp(cmd, "m") == 0 && has_a && has_b) {
+        if (a > 4095) a = 4095;
+        if (b > 4096 - a) b = 4096 - a; // b may be huge, e.g. strtoul("-1"), so don't add to it
+        CHIP8_MemoryDump(chip8, a, b);
+    } else if (strcmp(cmd, "b") == 0 && has_a && a < 4096) {
+        BIT_FLIP(debugger->breakpoints, a);
+        debugger->armed += BIT_GET(debugger->breakpoints, a) ? 1 : -1;
+        printf("Breakpoint at 0x%03lX %s.\n", a, BIT_GET(debugger->breakpoints, a) ? "set" : "cleared");
+    } else if (strcmp(cmd, "w") == 0 && has_a && a < 4096) {
+        BIT_FLIP(debugger->watch_memory, a);
+        debugger->armed += BIT_GET(debugger->watch_memory, a) ? 1 : -1;
+        printf("Watchpoint on mem[%lx] %s.\n", a, BIT_GET(debugger->watch_memory, a) ? "set" : "cleared");
+    } else if (strcmp(cmd, "wv") == 0 && has_a && a < 16) {
+        debugger->watch_registers ^= 1u << a;
+        debugger->armed += (debugger->watch_registers & (1u << a)) ? 1 : -1;
+        printf("Watchpoint on V[%lx] %s.\n", a, (debugger->watch_registers & (1u << a)) ? "set" : "cleared");
+    } else if (strcmp(cmd, "wi") == 0) {
+        debugger->watch_registers ^= DEBUGGER_WATCH_I;
+        debugger->armed += (debugger->watch_registers & DEBUGGER_WATCH_I) ? 1 : -1;
+        printf("Watchpoint on I %s.\n", (debugger->watch_registers & DEBUGGER_WATCH_I) ? "set" : "cleared");
+    } else if (strcmp(cmd, "l") == 0) {
+        DEBUGGER_List(debugger);
+    } else if (strcmp(cmd, "s") == 0 && strchr(args, '-') == NULL && (!has_a || a > 0)) {
+        // strtoul("-1") would be ULONG_MAX steps, hence no negative counts
+        debugger->stopped = 1;
+        debugger->steps = has_a ? a : 1;
+        DEBUGGER_ContinueSteps(debugger, chip8);
+    } else if (strcmp(cmd, "c") == 0 || strcmp(cmd, "p") == 0) {
+        debugger->stopped = 0;
+        debugger->steps = 0;
+        debugger->skip_break = 1;
+    } else {
+        printf("Commands: r, m <addr> <len>, b <addr>, w <addr>, wv <x>, wi, l, s [n], c\n");
+    }
+}
+
+/*
+    Returns 1 if the instruction that is about to be executed writes to a watched memory address.
+*/
+static int DEBUGGER_WritesWatched(Debugger *debugger, Chip8 *chip8, uint16_t opcode) {
+    int length;
+    if ((opcode & 0xF0FF) == 0xF033) length = 3;
+    else if ((opcode & 0xF0FF) == 0xF055) length = ((opcode & 0x0F00) >> 8) + 1;
+    else return 0;
+
+    for (int i = 0; i < length; i++) {
+        uint16_t addr = chip8->I + i;
+        if (addr < 4096 && BIT_GET(debugger->watch_memory, addr)) return 1;
+    }
+    return 0;
+}
+
+/*
+    Executes one instruction, checking breakpoints before and watchpoints after it.
+    Returns 1 if execution should stop.
+*/
+static int DEBUGGER_Execute(Debugger *debugger, Chip8 *chip8) {
+    if (!debugger->skip_break && BIT_GET(debugger->breakpoints, chip8->pc & 0x0FFF)) {
+        DEBUGGER_Stop(debugger, chip8, "Breakpoint");
+        return 1;
+    }
+    debugger->skip_break = 0;
+
+    uint16_t pc = chip8->pc;
+    uint16_t opcode = chip8->memory[pc] << 8 | chip8->memory[pc + 1];
+    int mem_hit = DEBUGGER_WritesWatched(debugger, chip8, opcode);
+    uint8_t V[16];
+    uint16_t I = chip8->I;
+    memcpy(V, chip8->V, sizeof(V));
+
+    if (debugger->profiler != NULL) PROFILER_Observe(debugger->profiler, chip8);
+    CHIP8_Step(chip8);
+    if (++debugger->cycle >= chip8->cycles_per_frame) {
+        debugger->cycle = 0;
+        CHIP8_UpdateTimers(chip8);
+    }
+
+    int hit = 0;
+    if (mem_hit) {
+        printf("mem[%x..] written by 0x%03X (%04X)\n", chip8->I, pc, opcode);
+        hit = 1;
+    }
+    for (int i = 0; i < 16; i++) {
+        if ((debugger->watch_registers & (1u << i)) && V[i] != chip8->V[i]) {
+            printf("V[%x]: 0x%x -> 0x%x at 0x%03X (%04X)\n", i, V[i], chip8->V[i], pc, opcode);
+            hit = 1;
+        }
+    }
+    if ((debugger->watch_registers & DEBUGGER_WATCH_I) && I != chip8->I) {
+        printf("I: 0x%x -> 0x%x at 0x%03X (%04X)\n", I, chip8->I, pc, opcode);
+        hit = 1;
+    }
+    if (hit) DEBUGGER_Stop(debugger, chip8, "Watchpoint");
+    return hit;
+}
+
+/*
+    Returns 1 if the instrumented core has to be used, i.e. if breakpoints or watchpoints
+    are set or if a frame was interrupted midway and has to be finished.
+*/
+int DEBUGGER_Active(Debugger *debugger) {
+    return debugger->armed > 0 || debugger->cycle != 0;
+}
+
+/*
+    Instrumented replacement for CHIP8_EmulateCycle, only used while DEBUGGER_Active
+    so that the regular core does not pay for breakpoints and watchpoints.
+    Runs the rest of the current frame, or until a breakpoint or watchpoint is hit.
+*/
+void DEBUGGER_EmulateCycle(Debugger *debugger, Chip8 *chip8) {
+    do {
+        if (DEBUGGER_Execute(debugger, chip8)) return;
+    } while (debugger->cycle != 0);
+}
+
+/*
+    Executes a single instruction, regardless of a breakpoint at the current PC.
+    Returns 1 if a watchpoint was hit.
+*/
+int DEBUGGER_Step(Debugger *debugger, Chip8 *chip8) {
+    debugger->skip_break = 1;
+    return DEBUGGER_Execute(debugger, chip8);
+}
+
+/*
+    Runs up to one frame's worth of the instructions left to step.
+    Called once per main loop iteration while stopped, so long step counts don't freeze the window.
+*/
+void DEBUGGER_ContinueSteps(Debugger *debugger, Chip8 *chip8) {
+    for (int i = 0; i < chip8->cycles_per_frame && debugger->steps > 0; i++) {
+        debugger->steps--;
+        if (DEBUGGER_Step(debugger, chip8)) {
+            debugger->steps = 0; // stopped by a watchpoint
+            return;
+        }
+    }
+    if (debugger->steps == 0) DEBUGGER_Stop(debugger, chip8, "Step");
+}
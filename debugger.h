@@ -0,0 +1,47 @@
+#ifndef DEBUGGER_H
+#define DEBUGGER_H
+
+#include "chip8.h"
+#include "profiler.h"
+#include <pthread.h>
+
+// bit 16 of watch_registers is the index register I, bits 0-15 are V0-VF
+#define DEBUGGER_WATCH_I    (1u << 16)
+
+typedef struct Debugger {
+    // one bit per memory address
+    uint8_t breakpoints[4096 / 8];
+    uint8_t watch_memory[4096 / 8];
+    uint32_t watch_registers;
+    // number of breakpoints and watchpoints that are set, the instrumented core is only used if > 0
+    int armed;
+
+    // 1 while execution is halted
+    int stopped;
+    // don't break on the breakpoint at the current PC (set when resuming from it)
+    int skip_break;
+    // instructions executed of the current frame, as a frame may be interrupted midway
+    int cycle;
+    // instructions left to step, run at most a frame's worth at a time so the window stays responsive
+    unsigned long steps;
+    // optional, kept in sync while the instrumented core runs
+    Profiler *profiler;
+
+    // line handed over from the console thread, so stdin is never read on the main thread
+    pthread_t console;
+    pthread_mutex_t lock;
+    pthread_cond_t consumed;
+    char command[128];
+    int has_command;
+} Debugger;
+
+void DEBUGGER_Initialize(Debugger *debugger);
+int DEBUGGER_StartConsole(Debugger *debugger);
+void DEBUGGER_PollConsole(Debugger *debugger, Chip8 *chip8);
+void DEBUGGER_Command(Debugger *debugger, Chip8 *chip8, const char *line);
+int DEBUGGER_Active(Debugger *debugger);
+void DEBUGGER_EmulateCycle(Debugger *debugger, Chip8 *chip8);
+int DEBUGGER_Step(Debugger *debugger, Chip8 *chip8);
+void DEBUGGER_ContinueSteps(Debugger *debugger, Chip8 *chip8);
+
+#endif
@@ -29,6 +29,20 @@ void shift_right(Chip8 *chip8);
 void sub_reg_flip(Chip8 *chip8);
 void shift_left(Chip8 *chip8);
 
+// Superinstructions (fused sequences of common instructions)
+enum {
+    FUSE_NONE,
+    FUSE_WAIT_DT,       // LD Vx, DT; SE/SNE Vx, kk; JP nnn
+    FUSE_DRAW,          // LD I, nnn; DRW Vx, Vy, n
+    FUSE_COUNT_SKIP,    // ADD Vx, kk; SE/SNE Vx, jj
+    FUSE_REGS_CALL,     // LD [I], Vx / LD Vx, [I]; CALL nnn
+    FUSE_KINDS
+};
+int fused_wait_dt(Chip8 *chip8);
+int fused_draw(Chip8 *chip8);
+int fused_count_skip(Chip8 *chip8);
+int fused_regs_call(Chip8 *chip8);
+
 // Array of function pointers to instructions
 void (*call_instruction[16]) (Chip8 *chip8) = {
     SUB_clear_return, jump, call, skip_eq, skip_neq, skip_eq_reg, load_reg,
@@ -39,3 +53,10 @@ void (*call_sub_8[8]) (Chip8 *chip8) = {
     copy, bit_or, bit_and, bit_xor,
     add_reg, sub_reg, shift_right, sub_reg_flip
 }; // 8xxE is extra
+
+// Fused handlers return the number of instructions they executed
+int (*call_fused[FUSE_KINDS]) (Chip8 *chip8) = {
+    NULL, fused_wait_dt, fused_draw, fused_count_skip, fused_regs_call
+};
+// Maximum number of instructions executed by each fused handler
+uint8_t fused_length[FUSE_KINDS] = { 1, 3, 2, 2, 2 };
@@ -0,0 +1,273 @@
+#define _POSIX_C_SOURCE 200112L // mmap
+#include "library.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define LIBRARY_HEADER_SIZE 16
+
+static const char library_magic[4] = { 'C', '8', 'L', '1' };
+
+// the index is used in place, so its layout must not depend on the compiler's padding
+typedef char library_entry_size_check[sizeof(LibraryEntry) == 56 ? 1 : -1];
+
+/*
+    FNV-1a, 64 bit. ROMs are identified by the hash of their contents.
+*/
+uint64_t LIBRARY_Hash(const uint8_t *data, size_t size) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < size; i++) hash = (hash ^ data[i]) * 1099511628211ull;
+    return hash;
+}
+
+static uint32_t LIBRARY_Read32(const uint8_t *p) {
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+/*
+    Maps a library file into memory and validates its header.
+    Returns 1 if successfull, 0 if not.
+*/
+int LIBRARY_Open(Library *library, const char *path) {
+    memset(library, 0, sizeof(Library));
+
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        fprintf(stderr, "Could not open %s.\n", path);
+        return 0;
+    }
+    LARGE_INTEGER size;
+    HANDLE mapping = NULL;
+    if (GetFileSizeEx(file, &size) && size.QuadPart >= LIBRARY_HEADER_SIZE) {
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    }
+    if (mapping == NULL) {
+        fprintf(stderr, "Could not map %s.\n", path);
+        CloseHandle(file);
+        return 0;
+    }
+    library->data = (const uint8_t*) MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    library->size = (size_t) size.QuadPart;
+    library->file = file;
+    library->mapping = mapping;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        fprintf(stderr, "Could not open %s.\n", path);
+        return 0;
+    }
+    struct stat st;
+    void *data = MAP_FAILED;
+    if (fstat(fd, &st) == 0 && st.st_size >= LIBRARY_HEADER_SIZE) {
+        data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd); // the mapping stays valid
+    if (data == MAP_FAILED) {
+        fprintf(stderr, "Could not map %s.\n", path);
+        return 0;
+    }
+    library->data = (const uint8_t*) data;
+    library->size = st.st_size;
+#endif
+    if (library->data == NULL) {
+        fprintf(stderr, "Could not map %s.\n", path);
+        LIBRARY_Close(library);
+        return 0;
+    }
+
+    uint32_t count = LIBRARY_Read32(library->data + 4);
+    uint32_t index_offset = LIBRARY_Read32(library->data + 8);
+    if (memcmp(library->data, library_magic, 4) != 0 || index_offset % 8 != 0
+            || index_offset > library->size || count > (library->size - index_offset) / sizeof(LibraryEntry)) {
+        fprintf(stderr, "%s is not a ROM library.\n", path);
+        LIBRARY_Close(library);
+        return 0;
+    }
+    library->index = (const LibraryEntry*) (library->data + index_offset);
+    library->count = count;
+    return 1;
+}
+
+void LIBRARY_Close(Library *library) {
+#ifdef _WIN32
+    if (library->data != NULL) UnmapViewOfFile(library->data);
+    if (library->mapping != NULL) CloseHandle((HANDLE) library->mapping);
+    if (library->file != NULL) CloseHandle((HANDLE) library->file);
+#else
+    if (library->data != NULL) munmap((void*) library->data, library->size);
+#endif
+    memset(library, 0, sizeof(Library));
+}
+
+/*
+    Binary search in the index. Returns NULL if there is no ROM with the given hash.
+*/
+const LibraryEntry *LIBRARY_Find(const Library *library, uint64_t hash) {
+    uint32_t lo = 0, hi = library->count;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (library->index[mid].hash < hash) lo = mid + 1;
+        else hi = mid;
+    }
+    if (lo < library->count && library->index[lo].hash == hash) return &library->index[lo];
+    return NULL;
+}
+
+/*
+    Linear search by title. Returns NULL if there is no ROM with the given title.
+*/
+const LibraryEntry *LIBRARY_FindTitle(const Library *library, const char *title) {
+    for (uint32_t i = 0; i < library->count; i++) {
+        if (strncmp(library->index[i].title, title, sizeof(library->index[i].title)) == 0) return &library->index[i];
+    }
+    return NULL;
+}
+
+/*
+    Loads a ROM straight from the mapped file into memory and applies its recommended clock.
+    Returns 1 if successfull, 0 if the entry points outside of the file or the ROM is too large.
+*/
+int LIBRARY_Load(const Library *library, const LibraryEntry *entry, Chip8 *chip8) {
+    if (entry->offset > library->size || entry->size > library->size - entry->offset) return 0;
+    if (!CHIP8_LoadProgram(chip8, library->data + entry->offset, entry->size)) return 0;
+    if (entry->cycles_per_frame > 0) chip8->cycles_per_frame = entry->cycles_per_frame;
+    return 1;
+}
+
+/*
+    Orders by hash. qsort is not stable, so equal hashes are ordered by their offset into
+    the ROM buffer, i.e. by catalog order, which makes the first duplicate the one that is kept.
+*/
+static int LIBRARY_CompareEntries(const void *a, const void *b) {
+    const LibraryEntry *ea = (const LibraryEntry*) a, *eb = (const LibraryEntry*) b;
+    if (ea->hash != eb->hash) return ea->hash < eb->hash ? -1 : 1;
+    return ea->offset < eb->offset ? -1 : ea->offset > eb->offset;
+}
+
+/*
+    Packs the ROMs listed in a catalog file into a library.
+    Each catalog line reads "<file> <cycles per frame> <run-ahead> <quirks> <title>",
+    with the file relative to the catalog. Lines starting with '#' are ignored.
+    Returns 1 if successfull, 0 if not.
+*/
+int LIBRARY_Build(const char *catalog_path, const char *out_path) {
+    FILE *catalog = fopen(catalog_path, "r");
+    if (catalog == NULL) {
+        fprintf(stderr, "Could not open %s.\n", catalog_path);
+        return 0;
+    }
+    const char *slash = strrchr(catalog_path, '/');
+    int dir_length = slash != NULL ? (int) (slash - catalog_path + 1) : 0;
+
+    LibraryEntry *entries = NULL;
+    uint8_t *roms = NULL;
+    uint32_t count = 0, capacity = 0, data_size = 0;
+    char line[512];
+    int ok = 1;
+    while (ok && fgets(line, sizeof(line), catalog) != NULL) {
+        char name[256], path[512];
+        unsigned cycles, runahead, quirks;
+        int title_start;
+        if (line[0] == '#' || sscanf(line, "%255s %u %u %u %n", name, &cycles, &runahead, &quirks, &title_start) != 4) {
+            continue;
+        }
+        line[strcspn(line, "\r\n")] = '\0';
+
+        uint8_t rom[MAX_PROGRAM_SIZE + 1];
+        snprintf(path, sizeof(path), "%.*s%s", dir_length, catalog_path, name);
+        FILE *f = fopen(path, "rb");
+        if (f == NULL) {
+            fprintf(stderr, "Could not open %s.\n", path);
+            ok = 0;
+            break;
+        }
+        size_t size = fread(rom, 1, sizeof(rom), f);
+        fclose(f);
+        if (size == 0 || size > MAX_PROGRAM_SIZE) {
+            fprintf(stderr, "%s does not fit into memory.\n", path);
+            ok = 0;
+            break;
+        }
+
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            LibraryEntry *grown = (LibraryEntry*) realloc(entries, capacity * sizeof(LibraryEntry));
+            if (grown == NULL) {
+                ok = 0;
+                break;
+            }
+            entries = grown;
+        }
+        uint8_t *grown = (uint8_t*) realloc(roms, data_size + size);
+        if (grown == NULL) {
+            ok = 0;
+            break;
+        }
+        roms = grown;
+
+        LibraryEntry *entry = &entries[count];
+        memset(entry, 0, sizeof(LibraryEntry));
+        entry->hash = LIBRARY_Hash(rom, size);
+        entry->offset = data_size; // into `roms` until the file is written
+        entry->size = size;
+        entry->cycles_per_frame = cycles;
+        entry->runahead = runahead;
+        entry->quirks = quirks;
+        strncpy(entry->title, line + title_start, sizeof(entry->title) - 1);
+
+        memcpy(roms + data_size, rom, size);
+        data_size += size;
+        count++;
+    }
+    fclose(catalog);
+
+    if (ok) {
+        qsort(entries, count, sizeof(LibraryEntry), LIBRARY_CompareEntries);
+        // the same ROM under several names: keep the first one
+        uint32_t unique = 0;
+        for (uint32_t i = 0; i < count; i++) {
+            if (unique > 0 && entries[unique - 1].hash == entries[i].hash) {
+                fprintf(stderr, "%s has the same contents as %s, skipped.\n", entries[i].title, entries[unique - 1].title);
+                continue;
+            }
+            entries[unique++] = entries[i];
+        }
+        count = unique;
+
+        FILE *out = fopen(out_path, "wb");
+        if (out == NULL) {
+            fprintf(stderr, "Could not open %s for writing.\n", out_path);
+            ok = 0;
+        } else {
+            uint32_t header[3] = { count, LIBRARY_HEADER_SIZE, 0 };
+            fwrite(library_magic, 1, sizeof(library_magic), out);
+            fwrite(header, sizeof(uint32_t), 3, out);
+            // the data section follows the index, in index order
+            uint32_t offset = LIBRARY_HEADER_SIZE + count * sizeof(LibraryEntry);
+            for (uint32_t i = 0; i < count; i++) {
+                LibraryEntry entry = entries[i];
+                entry.offset = offset;
+                offset += entry.size;
+                fwrite(&entry, sizeof(LibraryEntry), 1, out);
+            }
+            for (uint32_t i = 0; i < count; i++) fwrite(roms + entries[i].offset, 1, entries[i].size, out);
+            ok = fclose(out) == 0;
+            printf("Packed %u ROMs into %s.\n", (unsigned) count, out_path);
+        }
+    }
+
+    free(entries);
+    free(roms);
+    return ok;
+}
@@ -0,0 +1,42 @@
+#ifndef LIBRARY_H
+#define LIBRARY_H
+
+#include "chip8.h"
+
+/*
+    ROM library: many ROMs packed into one file that is memory-mapped once.
+        header: "C8L1", number of entries (4 bytes), offset of the index (4 bytes), reserved (4 bytes)
+        index:  LibraryEntry[count], sorted by hash
+        data:   the ROMs, back to back
+    Index entries are used in place, so the file is in the byte order of the machine that built it.
+*/
+
+typedef struct LibraryEntry {
+    uint64_t hash;              // FNV-1a of the ROM's contents
+    uint32_t offset;            // from the start of the file
+    uint16_t size;
+    uint16_t cycles_per_frame;  // recommended clock
+    uint8_t runahead;           // recommended run-ahead in frames
+    uint8_t quirks;             // compatibility quirks, carried along as the core has no quirk switches yet
+    char title[38];
+} LibraryEntry;
+
+typedef struct Library {
+    const uint8_t *data;
+    size_t size;
+    const LibraryEntry *index;
+    uint32_t count;
+    // platform handles of the mapping
+    void *file;
+    void *mapping;
+} Library;
+
+uint64_t LIBRARY_Hash(const uint8_t *data, size_t size);
+int LIBRARY_Open(Library *library, const char *path);
+void LIBRARY_Close(Library *library);
+const LibraryEntry *LIBRARY_Find(const Library *library, uint64_t hash);
+const LibraryEntry *LIBRARY_FindTitle(const Library *library, const char *title);
+int LIBRARY_Load(const Library *library, const LibraryEntry *entry, Chip8 *chip8);
+int LIBRARY_Build(const char *catalog_path, const char *out_path);
+
+#endif
@@ -1,13 +1,31 @@
 #include "chip8.h"
+#include "profiler.h"
+#include "debugger.h"
+#include "capture.h"
+#include "library.h"
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <time.h>
 #include <SDL2/SDL.h>
 
 #define SCALE   24
+#define MAX_RUNAHEAD    4
 
-int running, paused;
+int running;
 Chip8 chip8;
+Profiler profiler;
+Debugger debugger;
+// run-ahead: the frame shown is emulated this many frames into the future
+int runahead;
+int runahead_set; // given on the command line, overrides the library's recommendation
+Chip8 snapshot;
+uint8_t display[WIDTH * HEIGHT];
+Uint64 runaheadTicks; // time spent on run-ahead since the last report
+const char *profile_path; // NULL if profiling is disabled
+Capture capture;
+const char *record_path; // NULL if not recording
+Library library;
 SDL_Window* window;
 SDL_Renderer* renderer;
 
@@ -72,7 +90,10 @@ void pollEvents() {
                 return;
             case SDL_KEYDOWN:
                 if (event.key.keysym.scancode == SDL_SCANCODE_P) {
-                    paused = !paused;
+                    debugger.stopped = !debugger.stopped;
+                    debugger.skip_break = 1;
+                    debugger.steps = 0;
+                    printf(debugger.stopped ? "Paused.\n" : "Resumed.\n");
                 } else {
                     hexKey = scancodeToHexKey(event.key.keysym.scancode);
                     if (hexKey < 0) break;
@@ -90,7 +111,53 @@ void pollEvents() {
     }
 }
 
-void render() {
+/*
+    Emulates one frame and updates the displayed image.
+    With run-ahead, the state is saved, `runahead` more frames are emulated with the
+    current input, their final image is displayed and the state is restored afterwards.
+    That way the effect of a key press shows up to `runahead` frames earlier.
+*/
+void update() {
+    // the instrumented cores are only swapped in while needed
+    if (DEBUGGER_Active(&debugger)) DEBUGGER_EmulateCycle(&debugger, &chip8);
+    else if (profile_path != NULL) PROFILER_EmulateCycle(&profiler, &chip8);
+    else CHIP8_EmulateCycle(&chip8);
+
+    if (runahead > 0 && !debugger.stopped) {
+        Uint64 start = SDL_GetPerformanceCounter();
+        CHIP8_SaveState(&chip8, &snapshot);
+        for (int i = 0; i < runahead; i++) CHIP8_EmulateCycle(&chip8);
+        memcpy(display, chip8.gfx, sizeof(display));
+        CHIP8_LoadState(&chip8, &snapshot);
+        runaheadTicks += SDL_GetPerformanceCounter() - start;
+    } else {
+        memcpy(display, chip8.gfx, sizeof(display));
+    }
+
+    if (record_path != NULL) CAPTURE_Frame(&capture, chip8.gfx);
+}
+
+/*
+    Converts a recording, the format is chosen by the extension of the output file.
+*/
+int exportRecording(const char *path, const char *out_path, int scale) {
+    const char *ext = strrchr(out_path, '.');
+    CaptureFormat format;
+    if (ext != NULL && strcmp(ext, ".png") == 0) format = CAPTURE_PNG;
+    else if (ext != NULL && strcmp(ext, ".gif") == 0) format = CAPTURE_GIF;
+    else if (ext != NULL && strcmp(ext, ".y4m") == 0) format = CAPTURE_Y4M;
+    else {
+        printf("Unknown export format, use .png, .gif or .y4m.\n");
+        return 0;
+    }
+    if (scale < 1 || scale > CAPTURE_MAX_SCALE) {
+        scale = scale < 1 ? 1 : CAPTURE_MAX_SCALE;
+        printf("Scale clamped to %d.\n", scale);
+    }
+    return CAPTURE_Export(path, out_path, format, scale);
+}
+
+void render(const uint8_t *gfx) {
     // clear the screen (SDL, not CHIP-8)
     SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
     SDL_RenderFillRect(renderer, NULL);
@@ -99,7 +166,7 @@ void render() {
     SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
     for (int y = 0; y < 32; y++) {
         for (int x = 0; x < 64; x++) {
-            if (chip8.gfx[y * 64 + x]) {
+            if (gfx[y * 64 + x]) {
                 SDL_RenderDrawPoint(renderer, x, y);
             }
         }
@@ -109,35 +176,150 @@ void render() {
     SDL_RenderPresent(renderer);
 }
 
+/*
+    Loads a ROM from a file.
+    Returns 1 if successfull, 0 if not.
+*/
+int loadRomFile(const char *path) {
+    uint8_t program[MAX_PROGRAM_SIZE];
+    FILE *f = fopen(path, "rb");
+    if (f == NULL) {
+        printf("Could not open %s.\n", path);
+        return 0;
+    }
+    fseek(f, 0, SEEK_END);
+    long f_len = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    if (f_len <= 0 || f_len > MAX_PROGRAM_SIZE) {
+        printf("%s does not fit into memory (%ld bytes, at most %d).\n", path, f_len, MAX_PROGRAM_SIZE);
+        fclose(f);
+        return 0;
+    }
+    size_t read_size = fread(program, 1, f_len, f);
+    fclose(f);
+    if (read_size != (size_t) f_len || !CHIP8_LoadProgram(&chip8, program, read_size)) {
+        printf("Could not read %s.\n", path);
+        return 0;
+    }
+
+    printf("Program was loaded into memory. Size: %ld.\n", f_len);
+    return 1;
+}
+
+/*
+    Loads a ROM from a library, by its hash (16 hex digits) or title.
+    The library's recommended clock and run-ahead are applied.
+    Returns 1 if successfull, 0 if not.
+*/
+int loadRomLibrary(const char *path, const char *key) {
+    if (!LIBRARY_Open(&library, path)) {
+        return 0;
+    }
+
+    char *end;
+    const LibraryEntry *entry = NULL;
+    uint64_t hash = strtoull(key, &end, 16);
+    if (strlen(key) == 16 && *end == '\0') entry = LIBRARY_Find(&library, hash);
+    if (entry == NULL) entry = LIBRARY_FindTitle(&library, key);
+    if (entry == NULL) {
+        printf("%s is not in %s.\n", key, path);
+        return 0;
+    }
+    if (!LIBRARY_Load(&library, entry, &chip8)) {
+        printf("The library entry of %s is corrupt.\n", key);
+        return 0;
+    }
+    if (!runahead_set && entry->runahead <= MAX_RUNAHEAD) runahead = entry->runahead;
+
+    printf("Loaded \"%.*s\" (%016llx). Size: %u. Clock: %u instructions per frame. Quirks: 0x%02x.\n",
+        (int) sizeof(entry->title), entry->title, (unsigned long long) entry->hash,
+        entry->size, chip8.cycles_per_frame, entry->quirks);
+    return 1;
+}
+
 int main(int argc, char **argv) {
     if (argc < 2) {
         printf("Please provide a file/ROM.\n");
+        printf("Usage: %s <rom> [--runahead <0-%d>] [--record <out.c8v>]"
+            " [--profile <out.folded>] [--profile-interval <instructions>]\n", argv[0], MAX_RUNAHEAD);
+        printf("       %s --library <library.c8l> <hash or title> [options]\n", argv[0]);
+        printf("       %s --build-library <catalog.txt> <out.c8l>\n", argv[0]);
+        printf("       %s --export <in.c8v> <out.png|out.gif|out.y4m> [scale]\n", argv[0]);
         return 1;
     }
 
-    CHIP8_Initialize(&chip8);
+    if (strcmp(argv[1], "--export") == 0) {
+        if (argc < 4) {
+            printf("Please provide a recording and an output file.\n");
+            return 1;
+        }
+        return exportRecording(argv[2], argv[3], argc > 4 ? atoi(argv[4]) : 8) ? 0 : 1;
+    }
+    if (strcmp(argv[1], "--build-library") == 0) {
+        if (argc < 4) {
+            printf("Please provide a catalog and an output file.\n");
+            return 1;
+        }
+        return LIBRARY_Build(argv[2], argv[3]) ? 0 : 1;
+    }
 
-    FILE *f = fopen(argv[1], "rb");
-    fseek(f, 0, SEEK_END);
-    int f_len = ftell(f);
-    fseek(f, 0, SEEK_SET);
-    uint8_t *program = (uint8_t*) malloc(f_len * sizeof(uint8_t));
-    if (program == NULL) {
-        printf("Could not allocate memory for the program.\n");
+    // the ROM is either given as a file or as a library and an entry of it
+    const char *library_path = NULL;
+    const char *rom = argv[1];
+    int first_option = 2;
+    if (strcmp(argv[1], "--library") == 0) {
+        if (argc < 4) {
+            printf("Please provide a library and the hash or title of a ROM.\n");
+            return 1;
+        }
+        library_path = argv[2];
+        rom = argv[3];
+        first_option = 4;
+    }
+
+    uint32_t profile_interval = 97; // prime, so that sampling does not lock onto loops
+    for (int i = first_option; i < argc; i++) {
+        if (strcmp(argv[i], "--profile") == 0 && i + 1 < argc) {
+            profile_path = argv[++i];
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if (strcmp(argv[i], "--runahead") == 0 && i + 1 < argc) {
+            runahead = atoi(argv[++i]);
+            runahead_set = 1;
+            if (runahead < 0 || runahead > MAX_RUNAHEAD) {
+                printf("Run-ahead must be between 0 and %d frames.\n", MAX_RUNAHEAD);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "--profile-interval") == 0 && i + 1 < argc) {
+            profile_interval = strtoul(argv[++i], NULL, 10);
+        } else {
+            printf("Unknown option: %s\n", argv[i]);
+            return 1;
+        }
+    }
+    if (profile_path != NULL) PROFILER_Initialize(&profiler, profile_interval);
+
+    DEBUGGER_Initialize(&debugger);
+    if (profile_path != NULL) debugger.profiler = &profiler;
+    if (!DEBUGGER_StartConsole(&debugger)) {
         return 1;
     }
-    int read_size = fread(program, 1, f_len, f);
-    fclose(f);
 
-    CHIP8_LoadProgram(&chip8, program, f_len);
-    printf("Program was loaded into memory. Size: %d. Loaded: %d.\n", f_len, read_size);
+    CHIP8_Initialize(&chip8);
+
+    if (library_path != NULL ? !loadRomLibrary(library_path, rom) : !loadRomFile(rom)) {
+        return 1;
+    }
 
     if (!initGraphics()) {
         return 1;
     }
+    if (record_path != NULL && !CAPTURE_Start(&capture, record_path)) {
+        return 1;
+    }
 
     // for random number generation
-    srand(time(NULL));
+    CHIP8_Seed(&chip8, time(NULL));
 
     running = 1;
 
@@ -147,50 +329,56 @@ int main(int argc, char **argv) {
     Uint32 secTime = SDL_GetTicks();
     Uint32 quickTime = SDL_GetTicks();
     while (running) {
-        if (paused) {
-            pollEvents();
+        // debugger commands are read on another thread, so this never blocks
+        DEBUGGER_PollConsole(&debugger, &chip8);
 
-            char cmd = 0;
-            scanf("%c", &cmd);
-            while (getc(stdin) != '\n') {}
-            if (cmd == 'r') { //rdump
-                CHIP8_RegisterDump(&chip8);
-            } else if (cmd == 'm') { // mdupm
-                uint16_t start, length;
-                printf("Start address (uint): ");
-                scanf("%hu", &start);
-                while (getc(stdin) != '\n') {}
-                printf("Number of bytes (uint): ");
-                scanf("%hu", &length);
-                while (getc(stdin) != '\n') {}
-                CHIP8_MemoryDump(&chip8, start, length);
-            } else if (cmd == 'p') { // unpause
-                paused = 0;
-            }
+        if (debugger.stopped) {
+            // keep the window responsive while stopped, without spinning
+            if (debugger.steps > 0) DEBUGGER_ContinueSteps(&debugger, &chip8);
+            pollEvents();
+            render(chip8.gfx);
+            SDL_Delay(16);
+            quickTime = SDL_GetTicks(); // don't catch up on the time spent stopped
         } else {
             Uint32 curTime = SDL_GetTicks();
             delta += (curTime - quickTime) / (1000.0 / 60.0); // if delta = 1.0, then 1/60 of a second has passed
             quickTime = curTime;
             if (delta >= 1.0) {
                 pollEvents();
-                CHIP8_EmulateCycle(&chip8);
+                update();
                 updates++;
                 delta--;
             }
 
-            render();
+            render(display);
             frames++;
 
             // print ups and fps
             if (curTime - secTime > 1000) {
                 secTime = curTime;
-                printf("%d updates, %d fps\n", updates, frames);
+                printf("%d updates, %d fps", updates, frames);
+                if (runahead > 0 && updates > 0) {
+                    printf(", run-ahead (%d frames) costs %.1f us per update", runahead,
+                        runaheadTicks * 1e6 / SDL_GetPerformanceFrequency() / updates);
+                }
+                printf("\n");
                 updates = 0;
+                runaheadTicks = 0;
                 frames = 0;
             }
         }
     }
 
+    if (record_path != NULL) {
+        CAPTURE_Stop(&capture);
+        printf("Recorded %u changed frames to %s, %u dropped.\n",
+            (unsigned) capture.captured, record_path, (unsigned) capture.dropped);
+    }
+    if (profile_path != NULL && PROFILER_WriteFolded(&profiler, profile_path)) {
+        printf("Wrote %u profile samples to %s.\n", (unsigned) profiler.samples, profile_path);
+    }
+
+    if (library_path != NULL) LIBRARY_Close(&library);
     SDL_Quit();
     return 1;
 }
@@ -0,0 +1,106 @@
+#include "profiler.h"
+#include <stdio.h>
+#include <string.h>
+
+/*
+    Resets the profiler. A sample of the current call stack is taken every `interval` instructions.
+    The shadow call stack starts out with the program entry point as its only frame.
+*/
+void PROFILER_Initialize(Profiler *profiler, uint32_t interval) {
+    memset(profiler, 0, sizeof(Profiler));
+    profiler->interval = interval > 0 ? interval : 1;
+    profiler->countdown = profiler->interval;
+    profiler->frames[0] = MEM_ROM_RAM;
+    profiler->depth = 1;
+}
+
+/*
+    Adds one sample for the current shadow call stack.
+*/
+static void PROFILER_Sample(Profiler *profiler) {
+    // FNV-1a over the frame addresses
+    uint32_t hash = 2166136261u;
+    for (int i = 0; i < profiler->depth; i++) {
+        hash = (hash ^ profiler->frames[i]) * 16777619u;
+    }
+
+    profiler->samples++;
+    for (int probe = 0; probe < PROFILER_MAX_STACKS; probe++) {
+        ProfilerStack *entry = &profiler->stacks[(hash + probe) % PROFILER_MAX_STACKS];
+        if (entry->count == 0) {
+            // free slot, start a new stack
+            memcpy(entry->frames, profiler->frames, profiler->depth * sizeof(uint16_t));
+            entry->depth = profiler->depth;
+            entry->count = 1;
+            return;
+        }
+        if (entry->depth == profiler->depth
+                && memcmp(entry->frames, profiler->frames, profiler->depth * sizeof(uint16_t)) == 0) {
+            entry->count++;
+            return;
+        }
+    }
+    profiler->dropped++;
+}
+
+/*
+    Must be called right before the instruction at the program counter is executed.
+    Follows CALL (2nnn) and RET (00EE) to keep the shadow call stack up to date
+    and takes a sample every `interval` instructions.
+*/
+void PROFILER_Observe(Profiler *profiler, Chip8 *chip8) {
+    uint16_t opcode = chip8->memory[chip8->pc] << 8 | chip8->memory[chip8->pc + 1];
+
+    if (--profiler->countdown == 0) {
+        profiler->countdown = profiler->interval;
+        PROFILER_Sample(profiler);
+    }
+
+    if ((opcode & 0xF000) == 0x2000) {
+        if (profiler->depth < PROFILER_MAX_DEPTH) profiler->frames[profiler->depth++] = opcode & 0x0FFF;
+    } else if (opcode == 0x00EE) {
+        // never pop the entry point, even if the ROM returns more often than it calls
+        if (profiler->depth > 1) profiler->depth--;
+    }
+}
+
+/*
+    Same as CHIP8_EmulateCycle, but every instruction is observed by the profiler.
+*/
+void PROFILER_EmulateCycle(Profiler *profiler, Chip8 *chip8) {
+    for (int i = 0; i < chip8->cycles_per_frame; i++) {
+        PROFILER_Observe(profiler, chip8);
+        CHIP8_Step(chip8);
+    }
+    CHIP8_UpdateTimers(chip8);
+}
+
+/*
+    Writes all recorded call stacks in the folded format understood by flamegraph tools,
+    i.e. one line per stack: "0x200;0x2D4;0x2E0 <samples>".
+    Frames are named by their address, formatted like `chip8-to-asm --maddr` does.
+    Returns 1 if successfull, 0 if not.
+*/
+int PROFILER_WriteFolded(Profiler *profiler, const char *path) {
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        fprintf(stderr, "Could not open %s for writing.\n", path);
+        return 0;
+    }
+
+    for (int i = 0; i < PROFILER_MAX_STACKS; i++) {
+        ProfilerStack *entry = &profiler->stacks[i];
+        if (entry->count == 0) continue;
+        for (int j = 0; j < entry->depth; j++) {
+            fprintf(f, j == 0 ? "0x%03X" : ";0x%03X", entry->frames[j]);
+        }
+        fprintf(f, " %u\n", (unsigned) entry->count);
+    }
+    fclose(f);
+
+    if (profiler->dropped > 0) {
+        fprintf(stderr, "Profiler: %u of %u samples dropped (too many distinct call stacks).\n",
+            (unsigned) profiler->dropped, (unsigned) profiler->samples);
+    }
+    return 1;
+}
@@ -0,0 +1,40 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "chip8.h"
+
+// Maximum call depth that is tracked (the CHIP-8 stack has 16 entries, plus the entry point)
+#define PROFILER_MAX_DEPTH  17
+// Number of distinct call stacks that can be recorded
+#define PROFILER_MAX_STACKS 1024
+
+typedef struct ProfilerStack {
+    // routine entry addresses, frames[0] is the outermost one
+    uint16_t frames[PROFILER_MAX_DEPTH];
+    uint8_t depth;
+    // number of samples taken with exactly this call stack
+    uint32_t count;
+} ProfilerStack;
+
+typedef struct Profiler {
+    // take a sample every `interval` instructions
+    uint32_t interval;
+    uint32_t countdown;
+
+    // shadow call stack, kept in sync with CALL/RET
+    uint16_t frames[PROFILER_MAX_DEPTH];
+    uint8_t depth;
+
+    // hash table of recorded call stacks
+    ProfilerStack stacks[PROFILER_MAX_STACKS];
+    uint32_t samples;
+    // samples that could not be recorded because the table was full
+    uint32_t dropped;
+} Profiler;
+
+void PROFILER_Initialize(Profiler *profiler, uint32_t interval);
+void PROFILER_Observe(Profiler *profiler, Chip8 *chip8);
+void PROFILER_EmulateCycle(Profiler *profiler, Chip8 *chip8);
+int PROFILER_WriteFolded(Profiler *profiler, const char *path);
+
+#endif
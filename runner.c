@@ -0,0 +1,289 @@
+#define _POSIX_C_SOURCE 199309L // clock_gettime
+#include "chip8.h"
+#include "capture.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <unistd.h>
+#endif
+
+/*
+    Headless regression runner.
+    Every ROM is run with a fixed seed and scripted input for a fixed number of frames.
+    At every checkpoint, gfx, V, I and memory are hashed and compared against the
+    golden file <rom dir>/golden/<rom name>.golden. ROMs are spread across all cores.
+    With --record <dir>, every ROM's frames are also recorded to <dir>/<rom name>.c8v.
+*/
+
+#define MAX_ROMS        256
+#define MAX_CHECKPOINTS 64
+#define SEED            0xC8C8C8C8u
+
+typedef struct Job {
+    char path[512];
+    char golden[512];
+    uint64_t hashes[MAX_CHECKPOINTS];
+    int checkpoints;
+    // 1 = matches the golden file, 0 = mismatch, -1 = error (message in `error`)
+    int result;
+    int mismatch; // first checkpoint that differs
+    char error[128];
+    double seconds;
+    uint32_t dispatches;
+    uint32_t recorded; // changed frames written with --record
+} Job;
+
+Job jobs[MAX_ROMS];
+int job_count;
+int next_job;
+int frames = 600;
+int interval = 60;
+int update;
+const char *record_dir; // NULL if not recording
+
+/*
+    FNV-1a over the parts of the machine state that are compared.
+*/
+static uint64_t hashState(Chip8 *chip8) {
+    uint64_t hash = 14695981039346656037ull;
+    uint8_t I[2] = { chip8->I & 0xFF, chip8->I >> 8 };
+    const uint8_t *parts[4] = { chip8->gfx, chip8->V, I, chip8->memory };
+    size_t sizes[4] = { sizeof(chip8->gfx), sizeof(chip8->V), sizeof(I), sizeof(chip8->memory) };
+    for (int p = 0; p < 4; p++) {
+        for (size_t i = 0; i < sizes[p]; i++) hash = (hash ^ parts[p][i]) * 1099511628211ull;
+    }
+    return hash;
+}
+
+/*
+    Scripted input: every 20 frames a key is held down for 6 frames.
+    The keys follow a fixed pseudo random sequence, so every run presses the same keys.
+*/
+static void scriptInput(Chip8 *chip8, int frame, uint32_t *rng) {
+    if (frame % 20 == 0) {
+        *rng ^= *rng << 13;
+        *rng ^= *rng >> 17;
+        *rng ^= *rng << 5;
+        chip8->key[*rng % 16] = 1;
+    } else if (frame % 20 == 6) {
+        memset(chip8->key, 0, sizeof(chip8->key));
+    }
+}
+
+static double now() {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+static void runJob(Job *job) {
+    uint8_t program[4096];
+    Chip8 chip8;
+
+    FILE *f = fopen(job->path, "rb");
+    if (f == NULL) {
+        snprintf(job->error, sizeof(job->error), "could not open ROM");
+        job->result = -1;
+        return;
+    }
+    size_t size = fread(program, 1, sizeof(program), f);
+    fclose(f);
+    if (size == 0 || size > MAX_PROGRAM_SIZE) {
+        snprintf(job->error, sizeof(job->error), "ROM size %u out of range", (unsigned) size);
+        job->result = -1;
+        return;
+    }
+
+    Capture *capture = NULL;
+    if (record_dir != NULL) {
+        char record_path[1024];
+        const char *name = strrchr(job->path, '/');
+        snprintf(record_path, sizeof(record_path), "%s/%s.c8v", record_dir, name != NULL ? name + 1 : job->path);
+        // too big for a worker's stack
+        capture = (Capture*) malloc(sizeof(Capture));
+        if (capture == NULL || !CAPTURE_Start(capture, record_path)) {
+            free(capture);
+            snprintf(job->error, sizeof(job->error), "could not record to %s", record_dir);
+            job->result = -1;
+            return;
+        }
+        // nothing waits for a headless run, so keep every frame
+        capture->lossless = 1;
+    }
+
+    double start = now();
+    uint32_t rng = SEED;
+    CHIP8_Initialize(&chip8);
+    CHIP8_Seed(&chip8, SEED);
+    CHIP8_LoadProgram(&chip8, program, size);
+    for (int frame = 0; frame < frames; frame++) {
+        scriptInput(&chip8, frame, &rng);
+        CHIP8_EmulateCycle(&chip8);
+        if (capture != NULL) CAPTURE_Frame(capture, chip8.gfx);
+        if ((frame + 1) % interval == 0 && job->checkpoints < MAX_CHECKPOINTS) {
+            job->hashes[job->checkpoints++] = hashState(&chip8);
+        }
+    }
+    job->seconds = now() - start;
+    job->dispatches = chip8.dispatches;
+    if (capture != NULL) {
+        CAPTURE_Stop(capture);
+        job->recorded = capture->captured;
+        free(capture);
+    }
+
+    if (update) {
+        f = fopen(job->golden, "w");
+        if (f == NULL) {
+            snprintf(job->error, sizeof(job->error), "could not write the golden file");
+            job->result = -1;
+            return;
+        }
+        for (int i = 0; i < job->checkpoints; i++) {
+            fprintf(f, "%d %016llx\n", (i + 1) * interval, (unsigned long long) job->hashes[i]);
+        }
+        fclose(f);
+        job->result = 1;
+        return;
+    }
+
+    f = fopen(job->golden, "r");
+    if (f == NULL) {
+        snprintf(job->error, sizeof(job->error), "no golden file (run with --update)");
+        job->result = -1;
+        return;
+    }
+    job->result = 1;
+    for (int i = 0; i < job->checkpoints; i++) {
+        int frame;
+        unsigned long long hash;
+        if (fscanf(f, "%d %llx", &frame, &hash) != 2 || frame != (i + 1) * interval || hash != job->hashes[i]) {
+            job->result = 0;
+            job->mismatch = (i + 1) * interval;
+            break;
+        }
+    }
+    fclose(f);
+}
+
+static void *worker(void *arg) {
+    (void) arg;
+    int i;
+    while ((i = __atomic_fetch_add(&next_job, 1, __ATOMIC_RELAXED)) < job_count) {
+        runJob(&jobs[i]);
+    }
+    return NULL;
+}
+
+static int cpuCount() {
+#ifdef _WIN32
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors;
+#else
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? n : 1;
+#endif
+}
+
+static int isRom(const char *path) {
+    struct stat st;
+    const char *ext = strrchr(path, '.');
+    // disassemblies and the library catalog live next to the ROMs
+    if (ext != NULL && (strcmp(ext, ".asm") == 0 || strcmp(ext, ".txt") == 0)) return 0;
+    return stat(path, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+static void addRom(const char *dir, const char *name) {
+    if (job_count == MAX_ROMS) return;
+    Job *job = &jobs[job_count];
+    snprintf(job->path, sizeof(job->path), "%s/%s", dir, name);
+    if (!isRom(job->path)) return;
+    snprintf(job->golden, sizeof(job->golden), "%s/golden/%s.golden", dir, name);
+    job_count++;
+}
+
+/*
+    Adds a single ROM or all ROMs in a directory.
+*/
+static void addPath(const char *path) {
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        const char *slash = strrchr(path, '/');
+        if (slash == NULL) {
+            addRom(".", path);
+        } else {
+            char parent[512];
+            snprintf(parent, sizeof(parent), "%.*s", (int) (slash - path), path);
+            addRom(parent, slash + 1);
+        }
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] != '.') addRom(path, entry->d_name);
+    }
+    closedir(dir);
+}
+
+static int compareJobs(const void *a, const void *b) {
+    return strcmp(((const Job*) a)->path, ((const Job*) b)->path);
+}
+
+int main(int argc, char **argv) {
+    int threads = cpuCount();
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--update") == 0) {
+            update = 1;
+        } else if (strcmp(argv[i], "--frames") == 0 && i + 1 < argc) {
+            frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--jobs") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_dir = argv[++i];
+        } else {
+            addPath(argv[i]);
+        }
+    }
+    if (job_count == 0) {
+        printf("Usage: %s [--update] [--frames <n>] [--jobs <n>] [--record <dir>] <rom or directory>...\n", argv[0]);
+        return 1;
+    }
+    if (threads < 1) threads = 1;
+    if (threads > job_count) threads = job_count;
+    qsort(jobs, job_count, sizeof(Job), compareJobs);
+
+    pthread_t pool[64];
+    if (threads > 64) threads = 64;
+    double start = now();
+    for (int i = 0; i < threads; i++) pthread_create(&pool[i], NULL, worker, NULL);
+    for (int i = 0; i < threads; i++) pthread_join(pool[i], NULL);
+    double total = now() - start;
+
+    int failed = 0;
+    uint64_t dispatches = 0;
+    for (int i = 0; i < job_count; i++) {
+        Job *job = &jobs[i];
+        double ips = job->seconds > 0 ? (double) frames * CYCLES_PER_FRAME / job->seconds : 0.0;
+        printf("%-24s %8.2f ms %8.1f M instr/s %6.2f dispatches/frame  ", job->path, job->seconds * 1000, ips / 1e6,
+            (double) job->dispatches / frames);
+        dispatches += job->dispatches;
+        if (record_dir != NULL) printf("%5u frames recorded  ", (unsigned) job->recorded);
+        if (job->result < 0) printf("ERROR: %s\n", job->error);
+        else if (job->result == 0) printf("FAIL at frame %d\n", job->mismatch);
+        else printf(update ? "updated\n" : "ok\n");
+        failed += job->result != 1;
+    }
+    printf("%d ROMs, %d frames each, %d threads: %.2f ms, %d failed\n",
+        job_count, frames, threads, total * 1000, failed);
+    printf("%.2f dispatches per frame on average, for %d instructions per frame\n",
+        (double) dispatches / frames / job_count, CYCLES_PER_FRAME);
+    return failed > 0;
+}